@@ -0,0 +1,71 @@
+// NAME: BusRecovery.ino
+//
+// DESC: This is a library for an LCD display with an I2C board based on the
+// MCP23017 I2C Port Expander. It allows individual pin mapping from the MCP23017
+// to the 1602 LCD.
+//
+// This file is part of the LiquidCrystal_MCP23017_I2C for the Arduino environment.
+// https://github.com/ATrappmann/LiquidCrystal_MCP23017_I2C
+//
+// MIT License
+//
+// Copyright (c) 2020 Andreas Trappmann
+//
+// Permission is hereby granted, free of charge, to any person obtaining a copy
+// of this software and associated documentation files (the "Software"), to deal
+// in the Software without restriction, including without limitation the rights
+// to use, copy, modify, merge, publish, distribute, sublicense, and/or sell
+// copies of the Software, and to permit persons to whom the Software is
+// furnished to do so, subject to the following conditions:
+//
+// The above copyright notice and this permission notice shall be included in all
+// copies or substantial portions of the Software.
+//
+// THE SOFTWARE IS PROVIDED "AS IS", WITHOUT WARRANTY OF ANY KIND, EXPRESS OR
+// IMPLIED, INCLUDING BUT NOT LIMITED TO THE WARRANTIES OF MERCHANTABILITY,
+// FITNESS FOR A PARTICULAR PURPOSE AND NONINFRINGEMENT. IN NO EVENT SHALL THE
+// AUTHORS OR COPYRIGHT HOLDERS BE LIABLE FOR ANY CLAIM, DAMAGES OR OTHER
+// LIABILITY, WHETHER IN AN ACTION OF CONTRACT, TORT OR OTHERWISE, ARISING FROM,
+// OUT OF OR IN CONNECTION WITH THE SOFTWARE OR THE USE OR OTHER DEALINGS IN THE
+// SOFTWARE.
+#include <LiquidCrystal_MCP23017_I2C.h>
+#include <Wire.h>
+
+#define LCD_I2C_ADDR  0x20
+
+LiquidCrystal_MCP23017_I2C lcd(LCD_I2C_ADDR);
+
+// record of the display contents, replayed after a bus fault
+uint8_t shadow[LCD_SHADOW_SIZE];
+
+void setup() {
+  Serial.begin(9600);
+
+  Wire.begin();
+#ifdef WIRE_HAS_TIMEOUT
+  // don't hang forever on a stuck bus, also not in lcd.begin()
+  Wire.setWireTimeout(25000, true);
+#endif
+
+  lcd.setShadowBuffer(shadow);
+  lcd.begin(16, 2);
+  lcd.print(F("Hello World!"));
+}
+
+void loop() {
+  lcd.setCursor(0, 1);
+  lcd.print(millis() / 1000);
+
+  // retry after a failed recovery and detect a brown-out of the
+  // MCP23017, which is not reported on the bus
+  if (!lcd.checkConnection()) {
+    Serial.println(F("LCD not reachable"));
+  }
+
+  Serial.print(F("bus errors: "));    Serial.print(lcd.getBusErrors());
+  Serial.print(F(", recoveries: "));  Serial.print(lcd.getRecoveries());
+  Serial.print(F(", last took "));    Serial.print(lcd.getRecoveryTime());
+  Serial.println(F("us"));
+
+  delay(1000);
+}
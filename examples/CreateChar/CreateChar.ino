@@ -31,7 +31,8 @@
 //
 #include <LiquidCrystal_MCP23017_I2C.h>
 
-uint8_t arrow[8] = {
+// glyph is kept in flash memory, see createChar_P()
+const uint8_t arrow[8] PROGMEM = {
   B00000,
   B00100,
   B00010,
@@ -66,11 +67,11 @@ LiquidCrystal_MCP23017_I2C lcd(LCD_I2C_ADDR, LCD_RS_PIN, LCD_RW_PIN, LCD_EN_PIN,
 void setup() {
   lcd.begin(16, 2);
 
-  lcd.createChar(1, arrow);
+  lcd.createChar_P(1, arrow);
   lcd.clear();
 
   lcd.write(1);
-  lcd.print(" Hello World!");
+  lcd.print(F(" Hello World!"));
 }
 
 void loop() {
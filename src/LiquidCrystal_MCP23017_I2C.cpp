@@ -37,13 +37,57 @@
 #include "Arduino.h"
 #include <Wire.h>
 
-#define MCP23017_IODIRA  0x00
-#define MCP23017_IODIRB  0x01 
-#define MCP23017_GPIOA   0x12
-#define MCP23017_GPIOB   0x13
-
-#define MCP23017_digitalPinToPort(P)    ((((uint16_t)P) > 0x00ff) ? MCP23017_GPIOB : MCP23017_GPIOA)
-#define MCP23017_digitalPinToBitMask(P) ((((uint16_t)P) > 0x00ff) ? (P >> 8) : (P))
+#define MCP23017_IODIRA    0x00
+#define MCP23017_IODIRB    0x01
+#define MCP23017_GPINTENB  0x05
+#define MCP23017_IOCON     0x0A
+#define MCP23017_GPIOA     0x12
+#define MCP23017_GPIOB     0x13
+#define MCP23017_OLATA     0x14
+#define MCP23017_OLATB     0x15
+
+// packed 4-bit pin numbers: bit 3 selects GPIOB, bits 0..2 the bit within the port
+#define MCP23017_pinToPort(N)     (((N) & 0x08) ? MCP23017_GPIOB : MCP23017_GPIOA)
+#define MCP23017_pinToBitMask(N)  pgm_read_byte(MCP23017_bitMask + ((N) & 0x07))
+
+// bit masks of the pin numbers, avoids a shift loop on AVR
+static const uint8_t MCP23017_bitMask[8] PROGMEM = {
+  0x01, 0x02, 0x04, 0x08, 0x10, 0x20, 0x40, 0x80
+};
+
+// index into the packed pin mapping
+#define LCD_PIN_RS         0
+#define LCD_PIN_RW         1
+#define LCD_PIN_EN         2
+#define LCD_PIN_BACKLIGHT  3
+#define LCD_PIN_D0         4
+
+// flags for pin mapping
+#define LCD_PIN_HAS_RW         0x01  // RW is connected
+#define LCD_PIN_HAS_BACKLIGHT  0x02  // backlight is connected
+#define LCD_PIN_DATA_GPIOA     0x04  // data pins map 1:1 to the bits of GPIOA
+#define LCD_PIN_DATA_GPIOB     0x08  // data pins map 1:1 to the bits of GPIOB
+
+// flags for bus state
+#define LCD_BUS_ERROR   0x01  // a transmission failed, recovery is pending
+#define LCD_BUS_INIT    0x02  // begin() or recover() is running, don't recover
+#define LCD_BUS_REPLAY  0x04  // recover() is replaying, don't track the state
+#define LCD_BUS_OFFLINE 0x08  // recovery failed, only track the state until
+                              // checkConnection() or recover() succeeds
+
+// convert a MCP23017_Pxx bit mask to a packed 4-bit pin number
+static uint8_t MCP23017_digitalPinToPin(uint16_t pin) {
+  uint8_t num = 0;
+  if (pin > 0x00ff) {
+    num = 0x08;
+    pin >>= 8;
+  }
+  while (pin > 0x0001) {
+    pin >>= 1;
+    num++;
+  }
+  return num;
+}
 
 // When the display powers up, it is configured as follows:
 //
@@ -103,35 +147,51 @@ void LiquidCrystal_MCP23017_I2C::init(bool fourbitmode, uint8_t i2c_addr, uint16
 {
   _i2c_addr = i2c_addr;
 
-  _rs_pin = rs;
-  _rw_pin = rw;
-  _en_pin = en;
-  _backlight_pin = backlight;
-
-  _data_pins[0] = d0;
-  _data_pins[1] = d1;
-  _data_pins[2] = d2;
-  _data_pins[3] = d3;
-  _data_pins[4] = d4;
-  _data_pins[5] = d5;
-  _data_pins[6] = d6;
-  _data_pins[7] = d7;
-
-  // check if all data pins are on the same port
-  // we can do a faster i/o in write4bits and write8bits
+  setPin(LCD_PIN_RS, rs);
+  setPin(LCD_PIN_RW, rw);
+  setPin(LCD_PIN_EN, en);
+  setPin(LCD_PIN_BACKLIGHT, backlight);
+
+  setPin(LCD_PIN_D0 + 0, d0);
+  setPin(LCD_PIN_D0 + 1, d1);
+  setPin(LCD_PIN_D0 + 2, d2);
+  setPin(LCD_PIN_D0 + 3, d3);
+  setPin(LCD_PIN_D0 + 4, d4);
+  setPin(LCD_PIN_D0 + 5, d5);
+  setPin(LCD_PIN_D0 + 6, d6);
+  setPin(LCD_PIN_D0 + 7, d7);
+
+  _pin_flags = 0;
+  if (0 != rw) _pin_flags |= LCD_PIN_HAS_RW;
+  if (0 != backlight) _pin_flags |= LCD_PIN_HAS_BACKLIGHT;
+
+  // check if all data pins map 1:1 to the bits of one port,
+  // then we can do a faster i/o in write4bits and write8bits
   int firstPin = 0;
   if (fourbitmode) firstPin = 4;
-  _data_port = MCP23017_digitalPinToPort(_data_pins[firstPin]);
-  for (int i=firstPin+1; i<8; i++) {
-	  if (_data_port != MCP23017_digitalPinToPort(_data_pins[i])) {
-	    _data_port = 0;
-	    break;
-	  }
+  uint8_t port = getPin(LCD_PIN_D0 + firstPin) & 0x08;
+  uint8_t i;
+  for (i=firstPin; i<8; i++) {
+    if (getPin(LCD_PIN_D0 + i) != (port | i)) break;
+  }
+  if (8 == i) {
+    _pin_flags |= (port ? LCD_PIN_DATA_GPIOB : LCD_PIN_DATA_GPIOA);
   }
 
   _gpioa_value = 0x00;
   _gpiob_value = 0x00;
 
+  _shadow = NULL;
+  _glyphs = 0;
+  _address = LCD_SETDDRAMADDR;
+  _shift = 0;
+
+  // no recovery until begin() has been called
+  _bus_flags = LCD_BUS_INIT;
+  _bus_errors = 0;
+  _recoveries = 0;
+  _recovery_time = 0;
+
   if (fourbitmode)
     _displayfunction = LCD_4BITMODE | LCD_1LINE | LCD_5x8DOTS;
   else
@@ -153,6 +213,7 @@ void LiquidCrystal_MCP23017_I2C::begin(uint8_t cols, uint8_t lines, uint8_t dots
     _displayfunction |= LCD_5x10DOTS;
   }
 
+  _bus_flags = (_bus_flags & ~(LCD_BUS_ERROR | LCD_BUS_OFFLINE)) | LCD_BUS_INIT;
   Wire.begin();
 
   /*
@@ -170,19 +231,37 @@ void LiquidCrystal_MCP23017_I2C::begin(uint8_t cols, uint8_t lines, uint8_t dots
   }
   */
 
-  // set output direction
-  writeRegister(MCP23017_IODIRA, 0x00);
-  writeRegister(MCP23017_IODIRB, 0x00);
-
-  // clear all output pins
-  writeRegister(MCP23017_GPIOA, 0x00);
-  writeRegister(MCP23017_GPIOB, 0x00);
+  // set output direction and clear all output pins
+  _gpioa_value = 0x00;
+  _gpiob_value = 0x00;
+  restoreExpander();
 
   // SEE PAGE 45/46 FOR INITIALIZATION SPECIFICATION!
   // according to datasheet, we need at least 40ms after power rises above 2.7V
   // before sending commands. Arduino can turn on way before 4.5V so we'll wait 50
   delayMicroseconds(50000);
 
+  initInterface();
+
+  // turn the display on with no cursor or blinking default
+  _displaycontrol = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
+  display();
+  backlight();
+
+  // clear it off
+  clear();
+
+  // Initialize to default text direction (for romance languages)
+  _displaymode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
+  // set the entry mode
+  command(LCD_ENTRYMODESET | _displaymode);
+
+  _bus_flags &= ~LCD_BUS_INIT;
+}
+
+// (Re-)synchronize the LCD to 4 bit or 8 bit mode. This works
+// from any state, even if the LCD has only received half a byte.
+void LiquidCrystal_MCP23017_I2C::initInterface() {
   // Now we pull both RS and R/W low to begin commands
   /*
   digitalWrite(_rs_pin, LOW);
@@ -207,19 +286,19 @@ void LiquidCrystal_MCP23017_I2C::begin(uint8_t cols, uint8_t lines, uint8_t dots
     // figure 24, pg 46
 
     // we start in 8bit mode, try to set 4 bit mode
-    write4bits(0x03);
+    write4bits(0x30);
     delayMicroseconds(4500); // wait min 4.1ms
 
     // second try
-    write4bits(0x03);
+    write4bits(0x30);
     delayMicroseconds(4500); // wait min 4.1ms
 
     // third go!
-    write4bits(0x03);
+    write4bits(0x30);
     delayMicroseconds(150);
 
     // finally, set to 4-bit interface
-    write4bits(0x02);
+    write4bits(0x20);
   } else {
     // this is according to the hitachi HD44780 datasheet
     // page 45 figure 23
@@ -238,19 +317,6 @@ void LiquidCrystal_MCP23017_I2C::begin(uint8_t cols, uint8_t lines, uint8_t dots
 
   // finally, set # lines, font size, etc.
   command(LCD_FUNCTIONSET | _displayfunction);
-
-  // turn the display on with no cursor or blinking default
-  _displaycontrol = LCD_DISPLAYON | LCD_CURSOROFF | LCD_BLINKOFF;
-  display();
-  backlight();
-
-  // clear it off
-  clear();
-
-  // Initialize to default text direction (for romance languages)
-  _displaymode = LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT;
-  // set the entry mode
-  command(LCD_ENTRYMODESET | _displaymode);
 }
 
 void LiquidCrystal_MCP23017_I2C::setRowOffsets(int row0, int row1, int row2, int row3)
@@ -339,14 +405,14 @@ void LiquidCrystal_MCP23017_I2C::rightToLeft(void) {
 
 // Turn the (optional) backlight off/on
 void LiquidCrystal_MCP23017_I2C::noBacklight(void) {
-  if (0 != _backlight_pin) {
-    writePin(_backlight_pin, LOW);
+  if (_pin_flags & LCD_PIN_HAS_BACKLIGHT) {
+    writeBit(getPin(LCD_PIN_BACKLIGHT), LOW);
   }
 }
 
 void LiquidCrystal_MCP23017_I2C::backlight(void) {
-  if (0 != _backlight_pin) {
-    writePin(_backlight_pin, HIGH);
+  if (_pin_flags & LCD_PIN_HAS_BACKLIGHT) {
+    writeBit(getPin(LCD_PIN_BACKLIGHT), HIGH);
   }
 }
 
@@ -372,6 +438,27 @@ void LiquidCrystal_MCP23017_I2C::createChar(uint8_t location, uint8_t charmap[])
   }
 }
 
+// Same as createChar, but reads the character
+// bitmap directly from flash memory (PROGMEM)
+void LiquidCrystal_MCP23017_I2C::createChar_P(uint8_t location, const uint8_t *charmap) {
+  location &= 0x7; // we only have 8 locations 0-7
+  command(LCD_SETCGRAMADDR | (location << 3));
+  for (int i=0; i<8; i++) {
+    write(pgm_read_byte(charmap + i));
+  }
+}
+
+// Print a string from flash memory (PROGMEM)
+// without copying it to RAM first
+size_t LiquidCrystal_MCP23017_I2C::print_P(const char *str) {
+  size_t n = 0;
+  uint8_t c;
+  while (0 != (c = pgm_read_byte(str++))) {
+    n += write(c);
+  }
+  return n;
+}
+
 /*********** mid level commands, for sending data/cmds */
 
 inline void LiquidCrystal_MCP23017_I2C::command(uint8_t value) {
@@ -406,6 +493,15 @@ void LiquidCrystal_MCP23017_I2C::send(uint8_t value, uint8_t mode) {
     write4bits(value & 0xf0);
     write4bits(value << 4);
   }
+
+  if (!(_bus_flags & LCD_BUS_REPLAY)) {
+    if (mode) trackData(value);
+    else      trackCommand(value);
+  }
+
+  if ((_bus_flags & (LCD_BUS_ERROR | LCD_BUS_INIT | LCD_BUS_OFFLINE)) == LCD_BUS_ERROR) {
+    recover();
+  }
 }
 
 void LiquidCrystal_MCP23017_I2C::pulseEnable(void) {
@@ -427,37 +523,40 @@ void LiquidCrystal_MCP23017_I2C::pulseEnable(void) {
 }
 
 void LiquidCrystal_MCP23017_I2C::write4bits(uint8_t value) {
-  if (0 == _data_port) {
-    for (int i = 4; i < 8; i++) {
-      //digitalWrite(_data_pins[i], (value >> i) & 0x01);
-      writePin(_data_pins[i], (value >> i) & 0x01);
-	}
+  if (_pin_flags & LCD_PIN_DATA_GPIOA) {
+    _gpioa_value &= 0x0f;
+    _gpioa_value |= (value & 0xf0);
+    writeRegister(MCP23017_GPIOA, _gpioa_value);
+  }
+  else if (_pin_flags & LCD_PIN_DATA_GPIOB) {
+    _gpiob_value &= 0x0f;
+    _gpiob_value |= (value & 0xf0);
+    writeRegister(MCP23017_GPIOB, _gpiob_value);
   }
   else {
-	if (MCP23017_GPIOA ==	_data_port) {
-	  _gpioa_value &= 0x0f;
-	  _gpioa_value |= (value & 0xf0);
-	  writeRegister(_data_port, _gpioa_value);
-	}
-	else {
-	  _gpiob_value &= 0x0f;
-	  _gpiob_value |= (value & 0xf0);
-	  writeRegister(_data_port, _gpiob_value);
-	}
+    for (int i = 4; i < 8; i++) {
+      //digitalWrite(_data_pins[i], (value >> i) & 0x01);
+      writeBit(getPin(LCD_PIN_D0 + i), (value >> i) & 0x01);
+    }
   }
 
   pulseEnable();
 }
 
 void LiquidCrystal_MCP23017_I2C::write8bits(uint8_t value) {
-  if (0 == _data_port) {
-	  for (int i = 0; i < 8; i++) {
-		//digitalWrite(_data_pins[i], (value >> i) & 0x01);
-		writePin(_data_pins[i], (value >> i) & 0x01);
-	  }
+  if (_pin_flags & LCD_PIN_DATA_GPIOA) {
+    _gpioa_value = value;
+    writeRegister(MCP23017_GPIOA, _gpioa_value);
+  }
+  else if (_pin_flags & LCD_PIN_DATA_GPIOB) {
+    _gpiob_value = value;
+    writeRegister(MCP23017_GPIOB, _gpiob_value);
   }
   else {
-	writeRegister(_data_port, value);
+    for (int i = 0; i < 8; i++) {
+      //digitalWrite(_data_pins[i], (value >> i) & 0x01);
+      writeBit(getPin(LCD_PIN_D0 + i), (value >> i) & 0x01);
+    }
   }
 
   pulseEnable();
@@ -467,41 +566,356 @@ void LiquidCrystal_MCP23017_I2C::write8bits(uint8_t value) {
 /************ low level MCP23017 data pushing commands **************/
 
 void LiquidCrystal_MCP23017_I2C::writeRegister(uint8_t regAddr, uint8_t regValue) {
+  if (_bus_flags & LCD_BUS_OFFLINE) {
+    return; // the cached port values are written by recover()
+  }
+
   Wire.beginTransmission(_i2c_addr);
   Wire.write(regAddr);
   Wire.write(regValue);
   byte error = Wire.endTransmission();
   if (0 != error) {
-    if (Serial) {
-      Serial.print(F("Wire.write error #")); Serial.println(error);
-    }
+    _bus_errors++;
+    _bus_flags |= LCD_BUS_ERROR;
+  }
+}
+
+uint8_t LiquidCrystal_MCP23017_I2C::readRegister(uint8_t regAddr) {
+  Wire.beginTransmission(_i2c_addr);
+  Wire.write(regAddr);
+  byte error = Wire.endTransmission();
+  if ((0 == error) && (1 == Wire.requestFrom(_i2c_addr, (uint8_t)1))) {
+    return Wire.read();
   }
+  _bus_errors++;
+  _bus_flags |= LCD_BUS_ERROR;
+  return 0xff;
 }
 
 void LiquidCrystal_MCP23017_I2C::writePin(uint16_t pin, uint8_t value) {
-  uint8_t regAddr = MCP23017_digitalPinToPort(pin);
-  uint8_t bitmask = MCP23017_digitalPinToBitMask(pin);
+  writeBit(MCP23017_digitalPinToPin(pin), value);
+}
+
+void LiquidCrystal_MCP23017_I2C::writeBit(uint8_t pin, uint8_t value) {
+  uint8_t regAddr = MCP23017_pinToPort(pin);
+  uint8_t bitmask = MCP23017_pinToBitMask(pin);
 
+  // the cached port values are always written by recover(),
+  // so there is no need to write an unchanged pin again
   if (MCP23017_GPIOA == regAddr) {
-    if (value) _gpioa_value |= bitmask;
-    else       _gpioa_value &= ~bitmask;
+    uint8_t newValue = value ? (_gpioa_value | bitmask) : (_gpioa_value & ~bitmask);
+    if (newValue == _gpioa_value) return;
+    _gpioa_value = newValue;
     writeRegister(regAddr, _gpioa_value);
   }
   else {
-    if (value) _gpiob_value |= bitmask;
-    else       _gpiob_value &= ~bitmask;
+    uint8_t newValue = value ? (_gpiob_value | bitmask) : (_gpiob_value & ~bitmask);
+    if (newValue == _gpiob_value) return;
+    _gpiob_value = newValue;
     writeRegister(regAddr, _gpiob_value);
   }
 }
 
 void LiquidCrystal_MCP23017_I2C::writeRS(uint8_t value) {
-  writePin(_rs_pin, value);
+  writeBit(getPin(LCD_PIN_RS), value);
 }
 
 void LiquidCrystal_MCP23017_I2C::writeRW(uint8_t value) {
-  writePin(_rw_pin, value);
+  if (_pin_flags & LCD_PIN_HAS_RW) {
+    writeBit(getPin(LCD_PIN_RW), value);
+  }
 }
 
 void LiquidCrystal_MCP23017_I2C::writeEnable(uint8_t value) {
-  writePin(_en_pin, value);
+  writeBit(getPin(LCD_PIN_EN), value);
+}
+
+/************ packed pin mapping **************/
+
+uint8_t LiquidCrystal_MCP23017_I2C::getPin(uint8_t index) {
+  uint8_t pins = _pins[index >> 1];
+  return (index & 0x01) ? (pins >> 4) : (pins & 0x0f);
+}
+
+void LiquidCrystal_MCP23017_I2C::setPin(uint8_t index, uint16_t pin) {
+  uint8_t num = MCP23017_digitalPinToPin(pin);
+  if (index & 0x01) {
+    _pins[index >> 1] = (_pins[index >> 1] & 0x0f) | (num << 4);
+  }
+  else {
+    _pins[index >> 1] = (_pins[index >> 1] & 0xf0) | num;
+  }
+}
+
+/************ bus fault recovery **************/
+
+// Release a bus which is held low by a slave in the middle of a byte.
+// Wire is only restarted if SDA is stuck, because Wire.begin() resets
+// the clock of the bus for all other devices.
+void LiquidCrystal_MCP23017_I2C::clearBus() {
+#if defined(PIN_WIRE_SDA) && defined(PIN_WIRE_SCL) && !defined(ESP8266)
+  if (HIGH == digitalRead(PIN_WIRE_SDA)) {
+    return;
+  }
+
+  Wire.end();
+
+  pinMode(PIN_WIRE_SDA, INPUT_PULLUP);
+  pinMode(PIN_WIRE_SCL, INPUT_PULLUP);
+
+  // clock out the remaining bits until the slave releases SDA
+  for (int i=0; (i<9) && (LOW == digitalRead(PIN_WIRE_SDA)); i++) {
+    digitalWrite(PIN_WIRE_SCL, LOW);
+    pinMode(PIN_WIRE_SCL, OUTPUT);
+    delayMicroseconds(5);
+    pinMode(PIN_WIRE_SCL, INPUT_PULLUP);
+    delayMicroseconds(5);
+  }
+
+  // send a STOP condition: SDA goes high while SCL is high
+  digitalWrite(PIN_WIRE_SDA, LOW);
+  pinMode(PIN_WIRE_SDA, OUTPUT);
+  delayMicroseconds(5);
+  pinMode(PIN_WIRE_SDA, INPUT_PULLUP);
+  delayMicroseconds(5);
+
+  Wire.begin();
+#endif
+}
+
+// Write the configuration and the cached output pins to the MCP23017.
+// Stops at the first failed write.
+bool LiquidCrystal_MCP23017_I2C::restoreExpander() {
+  const uint8_t regs[][2] = {
+    // a glitch might have set IOCON.BANK, then IOCON is at the
+    // address of GPINTENB. Clear it there first, then at its
+    // address for IOCON.BANK = 0.
+    { MCP23017_GPINTENB, 0x00 },
+    { MCP23017_IOCON,    0x00 },
+    // set the output latches before the pins are switched to outputs
+    { MCP23017_OLATA,    _gpioa_value },
+    { MCP23017_OLATB,    _gpiob_value },
+    { MCP23017_IODIRA,   0x00 },
+    { MCP23017_IODIRB,   0x00 }
+  };
+
+  for (uint8_t i=0; i<sizeof(regs)/sizeof(*regs); i++) {
+    writeRegister(regs[i][0], regs[i][1]);
+    if (_bus_flags & LCD_BUS_ERROR) return false;
+  }
+  return true;
+}
+
+// Keep a record of the display contents for recover(). The buffer must
+// hold LCD_SHADOW_SIZE bytes and should be set before calling begin().
+void LiquidCrystal_MCP23017_I2C::setShadowBuffer(uint8_t *buffer) {
+  _shadow = buffer;
+  _glyphs = 0;
+  if (NULL != _shadow) {
+    memset(_shadow, ' ', LCD_DDRAM_SIZE);
+    memset(_shadow + LCD_DDRAM_SIZE, 0x00, LCD_CGRAM_SIZE);
+  }
+}
+
+// Check if the MCP23017 still has its configuration. A brown-out resets
+// all pins to inputs without any error on the bus. Recovers if needed.
+bool LiquidCrystal_MCP23017_I2C::checkConnection() {
+  if (_bus_flags & LCD_BUS_INIT) {
+    return false; // begin() has not been called
+  }
+
+  if ((0x00 != readRegister(MCP23017_IODIRA)) ||
+      (0x00 != readRegister(MCP23017_IODIRB)) ||
+      (_gpioa_value != readRegister(MCP23017_OLATA)) ||
+      (_gpiob_value != readRegister(MCP23017_OLATB))) {
+    _bus_flags |= LCD_BUS_ERROR;
+  }
+
+  if (_bus_flags & LCD_BUS_ERROR) {
+    return recover();
+  }
+  return true;
+}
+
+// Restore the MCP23017 and the LCD after a bus fault, without the slow
+// power-up delay of begin(). If a shadow buffer has been set, the display
+// is cleared and text and custom characters are replayed. Otherwise the
+// display contents are left as they are. If it fails, the bus is left
+// alone until the next call of checkConnection() or recover().
+bool LiquidCrystal_MCP23017_I2C::recover() {
+  if (_bus_flags & LCD_BUS_INIT) {
+    return false; // begin() has not been called or recover() is running
+  }
+
+  unsigned long start = micros();
+
+  _bus_flags = (_bus_flags & ~(LCD_BUS_ERROR | LCD_BUS_OFFLINE)) | LCD_BUS_INIT;
+
+  clearBus();
+  if (!restoreExpander()) {
+    // MCP23017 is still not reachable
+    _bus_flags = (_bus_flags & ~LCD_BUS_INIT) | LCD_BUS_OFFLINE;
+    return false;
+  }
+
+  _bus_flags |= LCD_BUS_REPLAY;
+
+  initInterface();
+
+  if (NULL != _shadow) {
+    command(LCD_DISPLAYCONTROL | (_displaycontrol & ~LCD_DISPLAYON));
+    command(LCD_CLEARDISPLAY);
+    delayMicroseconds(2000);
+    command(LCD_ENTRYMODESET | LCD_ENTRYLEFT | LCD_ENTRYSHIFTDECREMENT);
+
+    for (uint8_t location=0; location<8; location++) {
+      if (_glyphs & (1 << location)) {
+        command(LCD_SETCGRAMADDR | (location << 3));
+        for (int i=0; i<8; i++) {
+          write(_shadow[LCD_DDRAM_SIZE + (location << 3) + i]);
+        }
+      }
+    }
+
+    // the display is clear, write only the runs of non-blank characters
+    uint8_t lines = (_numlines > 1) ? 2 : 1;
+    uint8_t width = LCD_DDRAM_SIZE / lines;
+    for (uint8_t line=0; line<lines; line++) {
+      bool skipped = true;
+      for (uint8_t col=0; col<width; col++) {
+        uint8_t c = _shadow[line * width + col];
+        if (' ' == c) {
+          skipped = true;
+          continue;
+        }
+        if (skipped) {
+          command(LCD_SETDDRAMADDR | ((line << 6) + col));
+          skipped = false;
+        }
+        write(c);
+      }
+    }
+
+    // restore the display shift the shorter way round
+    if (_shift <= width / 2) {
+      for (uint8_t i=0; i<_shift; i++) command(LCD_CURSORSHIFT | LCD_DISPLAYMOVE | LCD_MOVELEFT);
+    } else {
+      for (uint8_t i=_shift; i<width; i++) command(LCD_CURSORSHIFT | LCD_DISPLAYMOVE | LCD_MOVERIGHT);
+    }
+  }
+
+  command(LCD_ENTRYMODESET | _displaymode);
+  command(_address);
+  command(LCD_DISPLAYCONTROL | _displaycontrol);
+
+  _bus_flags &= ~(LCD_BUS_INIT | LCD_BUS_REPLAY);
+  if (_bus_flags & LCD_BUS_ERROR) {
+    _bus_flags |= LCD_BUS_OFFLINE;
+    return false;
+  }
+
+  _recoveries++;
+  _recovery_time = micros() - start;
+  return true;
+}
+
+uint16_t LiquidCrystal_MCP23017_I2C::getBusErrors() {
+  return _bus_errors;
+}
+
+uint16_t LiquidCrystal_MCP23017_I2C::getRecoveries() {
+  return _recoveries;
+}
+
+unsigned long LiquidCrystal_MCP23017_I2C::getRecoveryTime() {
+  return _recovery_time;
+}
+
+/************ record of the LCD state for recover() **************/
+
+// Follow the commands, so recover() can restore the address counter,
+// display shift and modes, even if they were sent by command().
+void LiquidCrystal_MCP23017_I2C::trackCommand(uint8_t value) {
+  if (value & (LCD_SETDDRAMADDR | LCD_SETCGRAMADDR)) {
+    _address = value;
+  }
+  else if (value & LCD_FUNCTIONSET) {
+    // set by begin()
+  }
+  else if (value & LCD_CURSORSHIFT) {
+    if (value & LCD_DISPLAYMOVE) shiftDisplay(value & LCD_MOVERIGHT);
+    else                         moveAddress(value & LCD_MOVERIGHT);
+  }
+  else if (value & LCD_DISPLAYCONTROL) {
+    _displaycontrol = value & (LCD_DISPLAYON | LCD_CURSORON | LCD_BLINKON);
+  }
+  else if (value & LCD_ENTRYMODESET) {
+    _displaymode = value & (LCD_ENTRYLEFT | LCD_ENTRYSHIFTINCREMENT);
+  }
+  else if (value & LCD_RETURNHOME) {
+    // bit 0 is don't care
+    _address = LCD_SETDDRAMADDR;
+    _shift = 0;
+  }
+  else if (value == LCD_CLEARDISPLAY) {
+    _address = LCD_SETDDRAMADDR;
+    _shift = 0;
+    // clear display also sets the entry mode to increment
+    _displaymode |= LCD_ENTRYLEFT;
+    if (NULL != _shadow) {
+      memset(_shadow, ' ', LCD_DDRAM_SIZE);
+    }
+  }
+}
+
+void LiquidCrystal_MCP23017_I2C::trackData(uint8_t value) {
+  if (_address & LCD_SETDDRAMADDR) {
+    uint8_t index = shadowIndex(_address & 0x7f);
+    if ((NULL != _shadow) && (index < LCD_DDRAM_SIZE)) {
+      _shadow[index] = value;
+    }
+    if (_displaymode & LCD_ENTRYSHIFTINCREMENT) {
+      shiftDisplay(!(_displaymode & LCD_ENTRYLEFT));
+    }
+  }
+  else {
+    uint8_t addr = _address & 0x3f;
+    if (NULL != _shadow) {
+      _shadow[LCD_DDRAM_SIZE + addr] = value;
+    }
+    _glyphs |= 1 << (addr >> 3);
+  }
+  moveAddress(_displaymode & LCD_ENTRYLEFT);
+}
+
+// Move the address counter by one, like the HD44780 does
+void LiquidCrystal_MCP23017_I2C::moveAddress(bool right) {
+  if (_address & LCD_SETDDRAMADDR) {
+    uint8_t addr = _address & 0x7f;
+    if (_numlines > 1) {
+      if (right) addr = (0x27 == addr) ? 0x40 : ((0x67 == addr) ? 0x00 : addr + 1);
+      else       addr = (0x00 == addr) ? 0x67 : ((0x40 == addr) ? 0x27 : addr - 1);
+    } else {
+      if (right) addr = (0x4f == addr) ? 0x00 : addr + 1;
+      else       addr = (0x00 == addr) ? 0x4f : addr - 1;
+    }
+    _address = LCD_SETDDRAMADDR | (addr & 0x7f);
+  }
+  else {
+    _address = LCD_SETCGRAMADDR | ((_address + (right ? 1 : -1)) & 0x3f);
+  }
+}
+
+void LiquidCrystal_MCP23017_I2C::shiftDisplay(bool right) {
+  uint8_t width = (_numlines > 1) ? (LCD_DDRAM_SIZE / 2) : LCD_DDRAM_SIZE;
+  _shift = right ? ((_shift + width - 1) % width) : ((_shift + 1) % width);
+}
+
+// Index of a DDRAM address in the shadow buffer, LCD_DDRAM_SIZE if invalid
+uint8_t LiquidCrystal_MCP23017_I2C::shadowIndex(uint8_t addr) {
+  if (_numlines > 1) {
+    if ((addr & 0x3f) >= (LCD_DDRAM_SIZE / 2)) return LCD_DDRAM_SIZE;
+    return (addr & 0x40) ? ((addr & 0x3f) + (LCD_DDRAM_SIZE / 2)) : addr;
+  }
+  return (addr < LCD_DDRAM_SIZE) ? addr : LCD_DDRAM_SIZE;
 }
@@ -90,6 +90,11 @@
 #define LCD_5x10DOTS 0x04
 #define LCD_5x8DOTS 0x00
 
+// size of the shadow buffer for recover()
+#define LCD_DDRAM_SIZE 80
+#define LCD_CGRAM_SIZE 64
+#define LCD_SHADOW_SIZE (LCD_DDRAM_SIZE + LCD_CGRAM_SIZE)
+
 class LiquidCrystal_MCP23017_I2C : public Print {
 public:
   LiquidCrystal_MCP23017_I2C(uint8_t i2c_addr);
@@ -132,12 +137,21 @@ public:
 
   void setRowOffsets(int row1, int row2, int row3, int row4);
   void createChar(uint8_t, uint8_t[]);
+  void createChar_P(uint8_t, const uint8_t *);
+  size_t print_P(const char *);
   void setCursor(uint8_t, uint8_t);
   virtual size_t write(uint8_t);
   void command(uint8_t);
 
   using Print::write;
 
+  void setShadowBuffer(uint8_t *buffer);
+  bool checkConnection();
+  bool recover();
+  uint16_t getBusErrors();
+  uint16_t getRecoveries();
+  unsigned long getRecoveryTime();
+
 #ifdef MCP23017_DIRECT_PIN_ACCESS
 public:
 #else
@@ -146,7 +160,12 @@ private:
   void writePin(uint16_t pin, uint8_t value);
 
 private:
+  uint8_t getPin(uint8_t index);
+  void setPin(uint8_t index, uint16_t pin);
+
   void writeRegister(uint8_t regAddr, uint8_t regValue);
+  uint8_t readRegister(uint8_t regAddr);
+  void writeBit(uint8_t pin, uint8_t value);
   void writeRS(uint8_t value);
   void writeRW(uint8_t value);
   void writeEnable(uint8_t value);
@@ -156,13 +175,26 @@ private:
   void write8bits(uint8_t);
   void pulseEnable();
 
-  uint8_t  _i2c_addr;
-  uint16_t _rs_pin;       // LOW: command.  HIGH: character.
-  uint16_t _rw_pin;       // LOW: write to LCD.  HIGH: read from LCD.
-  uint16_t _en_pin;       // activated by a HIGH pulse.
-  uint16_t _data_pins[8];
-  uint16_t _data_port;
-  uint16_t _backlight_pin;
+  void clearBus();
+  bool restoreExpander();
+  void initInterface();
+
+  void trackCommand(uint8_t);
+  void trackData(uint8_t);
+  void moveAddress(bool right);
+  void shiftDisplay(bool right);
+  uint8_t shadowIndex(uint8_t addr);
+
+  uint8_t _i2c_addr;
+
+  // Pin mapping, packed as two 4-bit pin numbers per byte:
+  // RS, RW, EN, backlight, d0 .. d7. Bit 3 of a pin number
+  // selects GPIOB, bits 0..2 the bit within the port.
+  // RS - LOW: command.  HIGH: character.
+  // RW - LOW: write to LCD.  HIGH: read from LCD.
+  // EN - activated by a HIGH pulse.
+  uint8_t _pins[6];
+  uint8_t _pin_flags;
 
   uint8_t _gpioa_value;
   uint8_t _gpiob_value;
@@ -171,10 +203,19 @@ private:
   uint8_t _displaycontrol;
   uint8_t _displaymode;
 
-  uint8_t _initialized;
-
   uint8_t _numlines;
   uint8_t _row_offsets[4];
+
+  // record of the LCD state for recover()
+  uint8_t *_shadow;       // DDRAM and CGRAM contents, optional
+  uint8_t _glyphs;        // bit mask of the custom characters in use
+  uint8_t _address;       // last set address command with address counter
+  uint8_t _shift;         // display shift to the left
+
+  uint8_t _bus_flags;
+  uint16_t _bus_errors;
+  uint16_t _recoveries;
+  unsigned long _recovery_time;  // of last recovery in microseconds
 };
 
 #endif /* LIQUIDCRYSTAL_MCP23017_I2C_H */